@@ -0,0 +1,207 @@
+// STD
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// APSI
+#include "apsi/log.h"
+
+#include "bin_reader.h"
+
+using namespace std;
+using namespace apsi;
+
+namespace {
+    // 映射整个文件,离开作用域时自动解除映射
+    class MappedFile{
+    public:
+        MappedFile(const string &file_name)
+        {
+            int fd = open(file_name.c_str(), O_RDONLY);
+            if (fd < 0) {
+                APSI_LOG_ERROR("File `" << file_name << "` could not be opened for reading");
+                throw runtime_error("could not open file");
+            }
+
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                close(fd);
+                throw runtime_error("could not stat file");
+            }
+            size_ = static_cast<size_t>(st.st_size);
+
+            if (size_ > 0) {
+                void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED) {
+                    close(fd);
+                    throw runtime_error("could not mmap file");
+                }
+                data_ = static_cast<const unsigned char *>(data);
+                madvise(data, size_, MADV_SEQUENTIAL);
+            }
+            close(fd);
+        }
+
+        MappedFile(const MappedFile &) = delete;
+
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        ~MappedFile()
+        {
+            if (data_) {
+                munmap(const_cast<unsigned char *>(data_), size_);
+            }
+        }
+
+        const unsigned char *data() const
+        {
+            return data_;
+        }
+
+        size_t size() const
+        {
+            return size_;
+        }
+
+    private:
+        const unsigned char *data_ = nullptr;
+
+        size_t size_ = 0;
+    };
+} // namespace
+
+BinReader::BinReader(const string &file_name) : file_name_(file_name)
+{
+}
+
+bool BinReader::IsBinFile(const string &file_name)
+{
+    ifstream file(file_name, ios::binary);
+    char file_magic[sizeof(magic)];
+    if (!file.read(file_magic, sizeof(file_magic))) {
+        return false;
+    }
+    return memcmp(file_magic, magic, sizeof(magic)) == 0;
+}
+
+CSVReader::DBData BinReader::read() const
+{
+    MappedFile file(file_name_);
+
+    if (file.size() < header_byte_count) {
+        APSI_LOG_ERROR("File `" << file_name_ << "` is too small to hold a header");
+        throw runtime_error("invalid binary data file");
+    }
+    BinHeader header = LoadHeader(file.data());
+
+    if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version) {
+        APSI_LOG_ERROR("File `" << file_name_ << "` has an unsupported header");
+        throw runtime_error("invalid binary data file");
+    }
+    if (header.item_byte_count != sizeof(Item::value_type)) {
+        APSI_LOG_ERROR("File `" << file_name_ << "` has " << header.item_byte_count
+                                << "-byte items; expected " << sizeof(Item::value_type));
+        throw runtime_error("invalid binary data file");
+    }
+
+    if (header.label_byte_count > max_label_byte_count) {
+        APSI_LOG_ERROR("File `" << file_name_ << "` has " << header.label_byte_count
+                                << "-byte labels; at most " << max_label_byte_count << " are supported");
+        throw runtime_error("invalid binary data file");
+    }
+
+    size_t record_byte_count = size_t{ header.item_byte_count } + header.label_byte_count;
+    size_t data_byte_count = file.size() - header_byte_count;
+    if (data_byte_count / record_byte_count < header.record_count ||
+        data_byte_count != header.record_count * record_byte_count) {
+        APSI_LOG_ERROR("File `" << file_name_ << "` size does not match its record count");
+        throw runtime_error("invalid binary data file");
+    }
+
+    const unsigned char *record = file.data() + header_byte_count;
+    size_t record_count = static_cast<size_t>(header.record_count);
+
+    auto read_item = [](const unsigned char *ptr) {
+        Item::value_type value;
+        memcpy(value.data(), ptr, value.size());
+        return Item(value);
+    };
+
+    if (header.label_byte_count == 0) {
+        CSVReader::UnlabeledData result;
+        result.reserve(record_count);
+        for (size_t i = 0; i < record_count; i++, record += record_byte_count) {
+            result.push_back(read_item(record));
+        }
+        return result;
+    }
+
+    // SenderDB::set_data需要每条记录单独的Label,这里无法避免按行分配
+    CSVReader::LabeledData result;
+    result.reserve(record_count);
+    for (size_t i = 0; i < record_count; i++, record += record_byte_count) {
+        const unsigned char *label = record + header.item_byte_count;
+        result.emplace_back(read_item(record), Label(label, label + header.label_byte_count));
+    }
+    return result;
+}
+
+BinHeader BinReader::LoadHeader(const unsigned char *in)
+{
+    auto load_le = [&in](auto &value) {
+        value = 0;
+        for (size_t i = 0; i < sizeof(value); i++) {
+            value |= static_cast<remove_reference_t<decltype(value)>>(in[i]) << (8 * i);
+        }
+        in += sizeof(value);
+    };
+
+    BinHeader header;
+    memcpy(header.magic, in, sizeof(header.magic));
+    in += sizeof(header.magic);
+    load_le(header.version);
+    load_le(header.item_byte_count);
+    load_le(header.label_byte_count);
+    load_le(header.reserved);
+    load_le(header.record_count);
+    return header;
+}
+
+void BinReader::SaveHeader(const BinHeader &header, unsigned char *out)
+{
+    auto save_le = [&out](auto value) {
+        for (size_t i = 0; i < sizeof(value); i++) {
+            *out++ = static_cast<unsigned char>(value >> (8 * i));
+        }
+    };
+
+    memcpy(out, header.magic, sizeof(header.magic));
+    out += sizeof(header.magic);
+    save_le(header.version);
+    save_le(header.item_byte_count);
+    save_le(header.label_byte_count);
+    save_le(header.reserved);
+    save_le(header.record_count);
+}
+
+string BinReader::ToHex(const Item &item)
+{
+    static const char digits[] = "0123456789abcdef";
+    auto bytes = item.get_as<unsigned char>();
+
+    string result;
+    result.reserve(bytes.size() * 2);
+    for (unsigned char b : bytes) {
+        result.push_back(digits[b >> 4]);
+        result.push_back(digits[b & 0x0f]);
+    }
+    return result;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+// STD
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// APSI
+#include "apsi/item.h"
+
+// common
+#include "csv_reader.h"
+
+/**
+ * 预先hash过的二进制数据文件格式:
+ *   BinHeader(32字节,各整数字段按小端序存储,读写时显式转换,与主机字节序无关)
+ *   record_count 条定长记录: item(16字节,apsi::Item的值) + label(label_byte_count字节,不足补0)
+ * label_byte_count为0表示unlabeled数据,最大为BinReader::max_label_byte_count
+ * item必须是apsi::Item(const std::string &)对原始字符串计算出的hash值(即CSVReader和converter_cli使用的hash),
+ * 否则与csv加载的数据无法匹配,且不会有任何报错
+ */
+struct BinHeader{
+    char magic[8];
+
+    std::uint32_t version;
+
+    std::uint32_t item_byte_count;
+
+    std::uint32_t label_byte_count;
+
+    std::uint32_t reserved;
+
+    std::uint64_t record_count;
+};
+
+static_assert(sizeof(BinHeader) == 32, "BinHeader must be 32 bytes");
+
+class BinReader{
+public:
+    static constexpr char magic[8] = { 'A', 'P', 'S', 'I', 'B', 'I', 'N', '\0' };
+
+    static constexpr std::uint32_t version = 1;
+
+    static constexpr std::size_t header_byte_count = 32;
+
+    // 与SenderDB支持的最大label长度一致
+    static constexpr std::uint32_t max_label_byte_count = 1024;
+
+    BinReader(const std::string &file_name);
+
+    /**
+     * 通过文件头判断是否为二进制数据文件
+     * @param file_name
+     * @return
+     */
+    static bool IsBinFile(const std::string &file_name);
+
+    /**
+     * 以mmap方式一次性读取整个文件
+     * @return
+     */
+    CSVReader::DBData read() const;
+
+    /**
+     * 从header_byte_count字节的小端序数据中解析文件头
+     * @param in
+     * @return
+     */
+    static BinHeader LoadHeader(const unsigned char *in);
+
+    /**
+     * 把文件头按小端序写入header_byte_count字节的缓冲区
+     * @param header
+     * @param out
+     */
+    static void SaveHeader(const BinHeader &header, unsigned char *out);
+
+    /**
+     * 把item转换为十六进制字符串,用于输出结果
+     * @param item
+     * @return
+     */
+    static std::string ToHex(const apsi::Item &item);
+
+private:
+    std::string file_name_;
+};
@@ -0,0 +1,157 @@
+// STD
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// APSI
+#include "apsi/log.h"
+
+#include "cpu_affinity.h"
+
+using namespace std;
+using namespace apsi;
+using namespace apsi::util;
+
+vector<int> parse_cpu_list(const string &cpu_list)
+{
+    vector<int> cpus;
+    stringstream ss(cpu_list);
+    string token;
+
+    while (getline(ss, token, ',')) {
+        // Remove all whitespace
+        token.erase(remove_if(token.begin(), token.end(), [](int ch) { return isspace(ch); }), token.end());
+        if (token.empty()) {
+            continue;
+        }
+
+        size_t dash = token.find('-');
+        try {
+            if (dash == string::npos) {
+                cpus.push_back(stoi(token));
+            } else {
+                int first = stoi(token.substr(0, dash));
+                int last = stoi(token.substr(dash + 1));
+                if (first > last) {
+                    throw invalid_argument("range is reversed");
+                }
+                for (int cpu = first; cpu <= last; cpu++) {
+                    cpus.push_back(cpu);
+                }
+            }
+        } catch (const exception &ex) {
+            APSI_LOG_ERROR("Invalid cpu list `" << cpu_list << "`: " << ex.what());
+            throw invalid_argument("invalid cpu list");
+        }
+    }
+
+    if (any_of(cpus.begin(), cpus.end(), [](int cpu) { return cpu < 0; })) {
+        APSI_LOG_ERROR("Invalid cpu list `" << cpu_list << "`: negative cpu id");
+        throw invalid_argument("invalid cpu list");
+    }
+
+    sort(cpus.begin(), cpus.end());
+    cpus.erase(unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+bool pin_current_thread(const vector<int> &cpus)
+{
+    if (cpus.empty()) {
+        return true;
+    }
+
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cpus) {
+        if (cpu >= CPU_SETSIZE) {
+            APSI_LOG_ERROR("CPU id " << cpu << " exceeds CPU_SETSIZE");
+            return false;
+        }
+        CPU_SET(cpu, &cpu_set);
+    }
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (err != 0) {
+        APSI_LOG_ERROR("pthread_setaffinity_np failed with error " << err);
+        return false;
+    }
+    return true;
+#else
+    APSI_LOG_WARNING("CPU affinity is not supported on this platform; ignoring cpu list");
+    return false;
+#endif
+}
+
+vector<int> current_thread_cpus()
+{
+    vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    int err = pthread_getaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (err != 0) {
+        APSI_LOG_ERROR("pthread_getaffinity_np failed with error " << err);
+        return cpus;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpu_set)) {
+            cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
+
+bool pin_thread_pool(ThreadPool &pool, size_t thread_count, const vector<int> &cpus)
+{
+    if (cpus.empty() || thread_count == 0) {
+        return true;
+    }
+
+    // 每个任务都要等到所有任务开始执行后才返回,这样每个工作线程恰好领取一个任务
+    mutex mtx;
+    condition_variable cv;
+    size_t arrived = 0;
+    atomic<bool> all_pinned = true;
+
+    vector<future<void>> futures;
+    futures.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; i++) {
+        futures.push_back(pool.enqueue([&]() {
+            if (!pin_current_thread(cpus)) {
+                all_pinned = false;
+            }
+
+            unique_lock<mutex> lock(mtx);
+            arrived++;
+            cv.notify_all();
+
+            // 线程数少于任务数时避免死锁
+            if (!cv.wait_for(lock, chrono::seconds(10), [&]() { return arrived >= thread_count; })) {
+                all_pinned = false;
+            }
+        }));
+    }
+
+    for (auto &f : futures) {
+        f.get();
+    }
+
+    if (!all_pinned) {
+        APSI_LOG_WARNING("Not every thread in the pool could be pinned");
+    }
+    return all_pinned;
+}
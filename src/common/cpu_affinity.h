@@ -0,0 +1,40 @@
+#pragma once
+
+// STD
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// APSI
+#include "apsi/util/thread_pool.h"
+
+/**
+ * 解析cpu列表,格式如 "0-3,8,10-11"
+ * @param cpu_list
+ * @return cpu编号(升序去重);空字符串返回空列表
+ */
+std::vector<int> parse_cpu_list(const std::string &cpu_list);
+
+/**
+ * 把当前线程绑定到给定的cpu集合上;cpus为空时不做任何处理
+ * @param cpus
+ * @return 是否绑定成功
+ */
+bool pin_current_thread(const std::vector<int> &cpus);
+
+/**
+ * 获取当前线程允许运行的cpu集合,用于之后通过pin_current_thread恢复
+ * 注意新线程会继承创建它的线程的绑定
+ * @return cpu编号(升序);不支持的平台或获取失败时返回空列表
+ */
+std::vector<int> current_thread_cpus();
+
+/**
+ * 把线程池中的每个工作线程绑定到给定的cpu集合上
+ * 每个工作线程恰好执行一个绑定任务,绑定在线程的整个生命周期内有效
+ * @param pool
+ * @param thread_count 线程池中的线程数
+ * @param cpus
+ * @return 是否全部绑定成功
+ */
+bool pin_thread_pool(apsi::util::ThreadPool &pool, std::size_t thread_count, const std::vector<int> &cpus);
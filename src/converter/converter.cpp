@@ -0,0 +1,148 @@
+//
+// Convert csv data files to the pre-hashed binary format read by sender_cli and receiver_cli.
+//
+
+// std
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+// absl
+#include <absl/flags/flag.h>
+#include <absl/flags/parse.h>
+
+// apsi
+#include <apsi/log.h>
+
+// common
+#include "common/bin_reader.h"
+#include "common/csv_reader.h"
+
+using namespace std;
+using namespace apsi;
+
+// 参数定义
+ABSL_FLAG(string,csv_path,"./db.csv","input csv file path");
+ABSL_FLAG(string,output_path,"./db.bin","output file path");
+ABSL_FLAG(string,format,"bin","output format: bin (pre-hashed binary) or hex (csv with hashed items in hex, for comparing results)");
+
+/**
+ * 写入二进制文件
+ * @param db_data
+ * @param out_file
+ */
+void write_bin(const CSVReader::DBData &db_data,const string &out_file);
+
+/**
+ * 写入以十六进制hash值表示item的csv文件
+ * @param db_data
+ * @param out_file
+ */
+void write_hex(const CSVReader::DBData &db_data,const string &out_file);
+
+int main(int argc,char** argv){
+    apsi::Log::SetLogLevel(apsi::Log::Level::all);
+    absl::ParseCommandLine(argc,argv);
+
+    string csv_path = absl::GetFlag(FLAGS_csv_path);
+    string output_path = absl::GetFlag(FLAGS_output_path);
+    string format = absl::GetFlag(FLAGS_format);
+
+    CSVReader::DBData db_data;
+    try{
+        CSVReader reader(csv_path);
+        tie(db_data,ignore) = reader.read();
+    }catch(exception &ex){
+        APSI_LOG_ERROR("Could not open or read file " << csv_path << ":" << ex.what());
+        return -1;
+    }
+
+    try{
+        if(format == "bin"){
+            write_bin(db_data,output_path);
+        }else if(format == "hex"){
+            write_hex(db_data,output_path);
+        }else{
+            APSI_LOG_ERROR("Unknown output format " << format);
+            return -1;
+        }
+    }catch(exception &ex){
+        APSI_LOG_ERROR("Failed to write " << output_path << ":" << ex.what());
+        return -1;
+    }
+
+    APSI_LOG_INFO("Wrote output to " << output_path);
+    return 0;
+}
+
+void write_bin(const CSVReader::DBData &db_data,const string &out_file){
+    BinHeader header{};
+    copy(begin(BinReader::magic),end(BinReader::magic),header.magic);
+    header.version = BinReader::version;
+    header.item_byte_count = sizeof(Item::value_type);
+
+    // 与sender_cli处理csv时一致,label长度取最长的label,不足的补0
+    if(holds_alternative<CSVReader::LabeledData>(db_data)){
+        const auto &labeled_data = get<CSVReader::LabeledData>(db_data);
+        for(const auto &record : labeled_data){
+            header.label_byte_count = max(header.label_byte_count,static_cast<uint32_t>(record.second.size()));
+        }
+        header.record_count = labeled_data.size();
+    }else{
+        header.record_count = get<CSVReader::UnlabeledData>(db_data).size();
+    }
+
+    if(header.label_byte_count > BinReader::max_label_byte_count){
+        APSI_LOG_ERROR("Labels of " << header.label_byte_count << " bytes exceed the maximum of "
+                                    << BinReader::max_label_byte_count << " bytes");
+        throw invalid_argument("label too long");
+    }
+
+    ofstream ofs(out_file,ios::binary);
+    ofs.exceptions(ios_base::badbit | ios_base::failbit);
+    unsigned char header_data[BinReader::header_byte_count];
+    BinReader::SaveHeader(header,header_data);
+    ofs.write(reinterpret_cast<const char *>(header_data),sizeof(header_data));
+
+    auto write_item = [&ofs](const Item &item){
+        auto bytes = item.get_as<unsigned char>();
+        ofs.write(reinterpret_cast<const char *>(bytes.data()),bytes.size());
+    };
+
+    if(holds_alternative<CSVReader::LabeledData>(db_data)){
+        vector<char> label(header.label_byte_count);
+        for(const auto &[item,record_label] : get<CSVReader::LabeledData>(db_data)){
+            write_item(item);
+            fill(label.begin(),label.end(),0);
+            copy(record_label.begin(),record_label.end(),label.begin());
+            ofs.write(label.data(),label.size());
+        }
+    }else{
+        for(const auto &item : get<CSVReader::UnlabeledData>(db_data)){
+            write_item(item);
+        }
+    }
+
+    APSI_LOG_INFO("Converted " << header.record_count << " items with "
+                               << header.label_byte_count << "-byte labels");
+}
+
+void write_hex(const CSVReader::DBData &db_data,const string &out_file){
+    ofstream ofs(out_file);
+    ofs.exceptions(ios_base::badbit | ios_base::failbit);
+
+    if(holds_alternative<CSVReader::LabeledData>(db_data)){
+        for(const auto &[item,label] : get<CSVReader::LabeledData>(db_data)){
+            ofs << BinReader::ToHex(item);
+            if(!label.empty()){
+                ofs << "," << string(label.begin(),label.end());
+            }
+            ofs << "\n";
+        }
+    }else{
+        for(const auto &item : get<CSVReader::UnlabeledData>(db_data)){
+            ofs << BinReader::ToHex(item) << "\n";
+        }
+    }
+}
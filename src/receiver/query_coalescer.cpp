@@ -0,0 +1,210 @@
+// std
+#include <numeric>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+// apsi
+#include <apsi/log.h>
+
+// kuku
+#include <kuku/kuku.h>
+
+#include "query_coalescer.h"
+
+using namespace std;
+using namespace apsi;
+using namespace apsi::network;
+using namespace apsi::receiver;
+
+namespace {
+    // 与APSI receiver中cuckoo表的插入尝试次数相同
+    constexpr uint64_t cuckoo_insert_attempts = 500;
+} // namespace
+
+QueryCoalescer::QueryCoalescer(
+        Receiver &receiver,
+        const PSIParams &params,
+        Channel &channel,
+        size_t max_items,
+        chrono::milliseconds window
+) : receiver_(receiver), table_params_(params.table_params()), channel_(channel), max_items_(max_items), window_(window)
+{
+    if(max_items_ == 0){
+        throw invalid_argument("max_items must be positive");
+    }
+    worker_ = thread([this](){ run(); });
+}
+
+QueryCoalescer::~QueryCoalescer(){
+    {
+        lock_guard<mutex> lock(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+future<QueryCoalescer::Result> QueryCoalescer::submit(vector<Item> items){
+    auto job = make_unique<Job>();
+    job->items = std::move(items);
+    auto result = job->result.get_future();
+    {
+        lock_guard<mutex> lock(mtx_);
+        if(stop_){
+            throw logic_error("QueryCoalescer is stopped");
+        }
+        pending_item_count_ += job->items.size();
+        pending_.push_back(std::move(job));
+    }
+    cv_.notify_all();
+    return result;
+}
+
+void QueryCoalescer::run(){
+    while(true){
+        vector<unique_ptr<Job>> batch;
+        {
+            unique_lock<mutex> lock(mtx_);
+            cv_.wait(lock,[this](){ return stop_ || !pending_.empty(); });
+            if(pending_.empty()){
+                return;
+            }
+
+            // 等待窗口结束,或者已经攒够一次查询的item
+            auto deadline = chrono::steady_clock::now() + window_;
+            cv_.wait_until(lock,deadline,[this](){ return stop_ || pending_item_count_ >= max_items_; });
+
+            // 按提交顺序取出任务,直到达到容量上限;超过容量的单个任务单独查询
+            size_t item_count = 0;
+            while(!pending_.empty()){
+                size_t job_item_count = pending_.front()->items.size();
+                if(!batch.empty() && item_count + job_item_count > max_items_){
+                    break;
+                }
+                item_count += job_item_count;
+                pending_item_count_ -= job_item_count;
+                batch.push_back(std::move(pending_.front()));
+                pending_.pop_front();
+            }
+        }
+
+        process_batch(batch);
+    }
+}
+
+void QueryCoalescer::process_batch(vector<unique_ptr<Job>> &batch){
+    APSI_LOG_INFO("Coalescing " << batch.size() << " query jobs into one APSI query");
+    try{
+        query(batch);
+    }catch(const exception &ex){
+        // 网络或sender出错时channel可能已经不可用,不再重试,整批任务失败
+        APSI_LOG_ERROR("APSI query failed: " << ex.what());
+        for(auto &job : batch){
+            if(!job->done){
+                job->result.set_exception(current_exception());
+                job->done = true;
+            }
+        }
+    }
+}
+
+void QueryCoalescer::query(vector<unique_ptr<Job>> &batch){
+    // 去重:同一个item在cuckoo表中只能出现一次,重复的item只会在第一个位置得到结果
+    vector<Item> items;
+    unordered_map<Item,size_t> item_index;
+    vector<vector<size_t>> job_indices(batch.size());
+    for(size_t i = 0;i < batch.size();i++){
+        job_indices[i].reserve(batch[i]->items.size());
+        for(const auto &item : batch[i]->items){
+            auto [it,inserted] = item_index.emplace(item,items.size());
+            if(inserted){
+                items.push_back(item);
+            }
+            job_indices[i].push_back(it->second);
+        }
+    }
+
+    vector<HashedItem> oprf_items;
+    vector<LabelKey> label_keys;
+    APSI_LOG_INFO("Sending OPRF request for " << items.size() << " items");
+    tie(oprf_items,label_keys) = Receiver::RequestOPRF(items,channel_);
+    APSI_LOG_INFO("Received OPRF response for " << items.size() << " items");
+
+    vector<size_t> jobs(batch.size());
+    iota(jobs.begin(),jobs.end(),size_t(0));
+    query_jobs(batch,jobs,job_indices,oprf_items,label_keys);
+}
+
+void QueryCoalescer::query_jobs(
+        vector<unique_ptr<Job>> &batch,
+        const vector<size_t> &jobs,
+        const vector<vector<size_t>> &job_indices,
+        const vector<HashedItem> &oprf_items,
+        const vector<LabelKey> &label_keys
+){
+    // 取出这些任务用到的items
+    vector<HashedItem> query_items;
+    vector<LabelKey> query_label_keys;
+    unordered_map<size_t,size_t> query_index;
+    vector<vector<size_t>> query_job_indices(jobs.size());
+    for(size_t i = 0;i < jobs.size();i++){
+        query_job_indices[i].reserve(job_indices[jobs[i]].size());
+        for(size_t idx : job_indices[jobs[i]]){
+            auto [it,inserted] = query_index.emplace(idx,query_items.size());
+            if(inserted){
+                query_items.push_back(oprf_items[idx]);
+                query_label_keys.push_back(label_keys[idx]);
+            }
+            query_job_indices[i].push_back(it->second);
+        }
+    }
+
+    // request_query会在发送前把items插入cuckoo表,插入失败时直接抛出异常;
+    // 这里先用不加密的cuckoo表检查,失败时拆分任务,避免把cuckoo溢出与网络错误混在一起
+    if(!fits_cuckoo_table(query_items)){
+        if(jobs.size() == 1){
+            APSI_LOG_ERROR("Query job with " << query_items.size() << " items does not fit in the cuckoo table");
+            auto &job = batch[jobs.front()];
+            job->result.set_exception(make_exception_ptr(runtime_error("failed to insert items into cuckoo table")));
+            job->done = true;
+            return;
+        }
+
+        APSI_LOG_WARNING("Coalesced query of " << query_items.size() << " items does not fit in the cuckoo table; splitting "
+                                               << jobs.size() << " jobs in halves");
+        size_t half = jobs.size() / 2;
+        query_jobs(batch,vector<size_t>(jobs.begin(),jobs.begin() + half),job_indices,oprf_items,label_keys);
+        query_jobs(batch,vector<size_t>(jobs.begin() + half,jobs.end()),job_indices,oprf_items,label_keys);
+        return;
+    }
+
+    APSI_LOG_INFO("Sending APSI query");
+    auto records = make_shared<const vector<MatchRecord>>(receiver_.request_query(query_items,query_label_keys,channel_));
+    APSI_LOG_INFO("Receive APSI query response");
+
+    for(size_t i = 0;i < jobs.size();i++){
+        auto &job = batch[jobs[i]];
+        job->result.set_value(Result(records,std::move(query_job_indices[i])));
+        job->done = true;
+    }
+}
+
+bool QueryCoalescer::fits_cuckoo_table(const vector<HashedItem> &items) const{
+    // 与Receiver::create_query一致:不使用stash,seed为{ 0, 0 }
+    kuku::KukuTable cuckoo(
+            table_params_.table_size,
+            0,
+            table_params_.hash_func_count,
+            { 0, 0 },
+            cuckoo_insert_attempts,
+            { 0, 0 });
+
+    for(const auto &item : items){
+        auto kuku_item = item.get_as<kuku::item_type>().front();
+        if(!cuckoo.insert(kuku_item) && !cuckoo.query(kuku_item)){
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+// STD
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// APSI
+#include <apsi/item.h>
+#include <apsi/match_record.h>
+#include <apsi/network/channel.h>
+#include <apsi/psi_params.h>
+#include <apsi/receiver.h>
+
+/**
+ * 把多个小的查询任务合并成一次APSI查询
+ * 小查询只占用cuckoo表中很少的位置,而查询开销几乎与查询的item数量无关;
+ * 在时间窗口内收集到的任务会被去重后打包成一次OPRF请求和一次query,再把结果拆分回各个任务
+ */
+class QueryCoalescer{
+public:
+    /**
+     * 单个任务的查询结果,与任务提交的items一一对应
+     * 同一批次中的任务共享该批次的MatchRecord,不做拷贝
+     */
+    class Result{
+    public:
+        Result() = default;
+
+        Result(std::shared_ptr<const std::vector<apsi::receiver::MatchRecord>> records, std::vector<std::size_t> indices)
+            : records_(std::move(records)), indices_(std::move(indices))
+        {}
+
+        std::size_t size() const noexcept
+        {
+            return indices_.size();
+        }
+
+        const apsi::receiver::MatchRecord &operator[](std::size_t i) const
+        {
+            return (*records_)[indices_[i]];
+        }
+
+    private:
+        std::shared_ptr<const std::vector<apsi::receiver::MatchRecord>> records_;
+
+        std::vector<std::size_t> indices_;
+    };
+
+    QueryCoalescer() = delete;
+
+    /**
+     * @param receiver
+     * @param params receiver使用的PSI参数,用于在查询前检查cuckoo表能否容纳items
+     * @param channel 已连接的channel,只由合并线程使用
+     * @param max_items 每次查询最多包含的item数量,通常为cuckoo表大小
+     * @param window 收到第一个任务后等待更多任务的时间
+     */
+    QueryCoalescer(
+            apsi::receiver::Receiver &receiver,
+            const apsi::PSIParams &params,
+            apsi::network::Channel &channel,
+            std::size_t max_items,
+            std::chrono::milliseconds window);
+
+    ~QueryCoalescer();
+
+    /**
+     * 提交一个查询任务,可以从多个线程并发调用
+     * @param items
+     * @return 任务的查询结果
+     */
+    std::future<Result> submit(std::vector<apsi::Item> items);
+
+private:
+    struct Job{
+        std::vector<apsi::Item> items;
+
+        std::promise<Result> result;
+
+        // result是否已经设置
+        bool done = false;
+    };
+
+    apsi::receiver::Receiver &receiver_;
+
+    apsi::PSIParams::TableParams table_params_;
+
+    apsi::network::Channel &channel_;
+
+    std::size_t max_items_;
+
+    std::chrono::milliseconds window_;
+
+    std::mutex mtx_;
+
+    std::condition_variable cv_;
+
+    std::deque<std::unique_ptr<Job>> pending_;
+
+    std::size_t pending_item_count_ = 0;
+
+    bool stop_ = false;
+
+    std::thread worker_;
+
+    void run();
+
+    /**
+     * 把一批任务合并成一次查询;网络或sender出错时整批任务失败
+     * @param batch
+     */
+    void process_batch(std::vector<std::unique_ptr<Job>> &batch);
+
+    /**
+     * 对整批任务做一次OPRF请求(items在batch内去重),再执行查询
+     * @param batch
+     */
+    void query(std::vector<std::unique_ptr<Job>> &batch);
+
+    /**
+     * 对batch中的部分任务执行一次APSI查询,复用已有的OPRF结果
+     * 如果这些任务的items无法全部插入cuckoo表,则把任务分成两半分别查询;单个任务无法插入时该任务失败
+     * @param batch
+     * @param jobs 参与本次查询的任务在batch中的下标
+     * @param job_indices 每个任务的items在oprf_items中的下标
+     * @param oprf_items
+     * @param label_keys
+     */
+    void query_jobs(
+            std::vector<std::unique_ptr<Job>> &batch,
+            const std::vector<std::size_t> &jobs,
+            const std::vector<std::vector<std::size_t>> &job_indices,
+            const std::vector<apsi::HashedItem> &oprf_items,
+            const std::vector<apsi::LabelKey> &label_keys);
+
+    /**
+     * 用与Receiver::create_query相同参数的cuckoo表插入items,不做任何加密
+     * @param items
+     * @return 是否全部插入成功
+     */
+    bool fits_cuckoo_table(const std::vector<apsi::HashedItem> &items) const;
+};
@@ -5,6 +5,9 @@
 // std
 #include <iostream>
 #include <fstream>
+#include <future>
+#include <chrono>
+#include <sstream>
 
 // absl
 #include <absl/log/log.h>
@@ -17,8 +20,13 @@
 #include <apsi/log.h>
 
 // common
+#include "common/bin_reader.h"
+#include "common/cpu_affinity.h"
 #include "common/csv_reader.h"
 
+// receiver
+#include "query_coalescer.h"
+
 using namespace std;
 using namespace apsi;
 using namespace apsi::receiver;
@@ -27,14 +35,24 @@ using namespace apsi::receiver;
 using namespace apsi::network;
 
 // 参数定义
-ABSL_FLAG(string,query_path,"./query.csv","query file path" );
-ABSL_FLAG(string,result_path,"./result.csv","result file path" );
+ABSL_FLAG(string,query_path,"./query.csv","query file path(csv or pre-hashed binary); comma-separated paths are queried as separate jobs" );
+ABSL_FLAG(string,result_path,"./result.csv","result file path; one per query file when several are given" );
 ABSL_FLAG(uint32_t ,thread,10,"Number of threads");
+ABSL_FLAG(string,cpus,"","CPUs to pin worker threads to, e.g. 0-7 (default is no pinning)");
 ABSL_FLAG(string,sender_address,"127.0.0.1:1212","The address of sender");
+ABSL_FLAG(uint32_t ,coalesce_window_ms,20,"Time window in milliseconds for coalescing query jobs into one APSI query");
+ABSL_FLAG(uint32_t ,coalesce_max_items,0,"Maximum number of items in one coalesced APSI query (default is 80% of the cuckoo table size)");
 
-// load db from csv
+// load db from csv or pre-hashed binary file
 pair<unique_ptr<CSVReader::DBData>,vector<string>> load_db(const string &db_file);
 
+/**
+ * split comma-separated paths
+ * @param paths
+ * @return
+ */
+vector<string> split_paths(const string &paths);
+
 /**
  * output intersection results;
  * @param orig_items
@@ -44,7 +62,7 @@ pair<unique_ptr<CSVReader::DBData>,vector<string>> load_db(const string &db_file
  */
 void print_intersection_result(
         const vector<string> & orig_items,const vector<Item> &items,
-        const vector<MatchRecord> &intersection,
+        const QueryCoalescer::Result &intersection,
         const string &out_file
         );
 
@@ -87,46 +105,84 @@ int main(int argc,char** argv){
     ThreadPoolMgr::SetThreadCount(absl::GetFlag(FLAGS_thread));
     APSI_LOG_INFO("Setting thread count to " << ThreadPoolMgr::GetThreadCount())
 
-    // load data
-    string db_file = absl::GetFlag(FLAGS_query_path);
-    auto [query_data,orig_items] = load_db(db_file);
-    if(!query_data || !holds_alternative<CSVReader::UnlabeledData>(*query_data)){
-        APSI_LOG_ERROR( "Failed to read query file:terminating");
+    // 持有ThreadPoolMgr,使全局线程池的cpu绑定在整个运行期间有效
+    ThreadPoolMgr tpm;
+    try{
+        vector<int> cpus = parse_cpu_list(absl::GetFlag(FLAGS_cpus));
+        if(!cpus.empty()){
+            bool pinned = pin_current_thread(cpus);
+            pinned = pin_thread_pool(tpm.thread_pool(),ThreadPoolMgr::GetThreadCount(),cpus) && pinned;
+            if(pinned){
+                APSI_LOG_INFO("Pinned worker threads to " << absl::GetFlag(FLAGS_cpus));
+            }else{
+                APSI_LOG_WARNING("Failed to pin worker threads to " << absl::GetFlag(FLAGS_cpus));
+            }
+        }
+    }catch(const exception &ex){
+        APSI_LOG_ERROR("Invalid cpu list: " << ex.what());
         return -1;
     }
 
-    // use oprf function to items
-    auto &items = get<CSVReader::UnlabeledData>(*query_data);
-    vector<Item> items_vec(items.begin(),items.end());
-
-    vector<HashedItem> oprf_items;
-    vector<LabelKey> label_keys;
-    try{
-        APSI_LOG_INFO("Sending OPRF request for " << items_vec.size() << " items");
-        tie(oprf_items,label_keys) = Receiver::RequestOPRF(items_vec,channel);
-        APSI_LOG_INFO("Received OPRF response for " << items_vec.size() << " items");
-    }catch(exception &ex){
-        APSI_LOG_ERROR("OPRF request failed:" << ex.what());
+    // load data
+    vector<string> query_files = split_paths(absl::GetFlag(FLAGS_query_path));
+    vector<string> result_files = split_paths(absl::GetFlag(FLAGS_result_path));
+    if(query_files.empty()){
+        APSI_LOG_ERROR("No query file given:terminating");
+        return -1;
+    }
+    if(query_files.size() > 1 && result_files.size() != query_files.size()){
+        APSI_LOG_ERROR("Number of result files must match number of query files:terminating");
         return -1;
     }
+    result_files.resize(query_files.size());
 
-    // query
-    vector<MatchRecord> query_result;
-    Receiver receiver(*params);
-    try{
-        APSI_LOG_INFO("Sending APSI query");
-        query_result  = receiver.request_query(oprf_items,label_keys,channel);
-        APSI_LOG_INFO("Receive APSI query response");
-    }catch(exception &ex){
-        APSI_LOG_ERROR("Failed sending  APSI query:" << ex.what());
+    vector<vector<string>> orig_items(query_files.size());
+    vector<vector<Item>> items_vec(query_files.size());
+    for(size_t i = 0;i < query_files.size();i++){
+        auto [query_data,file_orig_items] = load_db(query_files[i]);
+        if(!query_data || !holds_alternative<CSVReader::UnlabeledData>(*query_data)){
+            APSI_LOG_ERROR( "Failed to read query file " << query_files[i] << ":terminating");
+            return -1;
+        }
+        auto &items = get<CSVReader::UnlabeledData>(*query_data);
+        items_vec[i].assign(items.begin(),items.end());
+        orig_items[i] = std::move(file_orig_items);
     }
 
-    // output intersection result
-    print_intersection_result(orig_items,items_vec,query_result,absl::GetFlag(FLAGS_result_path));
+    // query: 每个查询文件作为一个任务提交,在时间窗口内的任务会被合并成一次APSI查询
+    size_t max_items = absl::GetFlag(FLAGS_coalesce_max_items);
+    if(max_items == 0){
+        // 3个hash函数且没有stash时,cuckoo表填充超过约90%就容易插入失败,默认只填充80%
+        max_items = max<size_t>(1,params->table_params().table_size * 4 / 5);
+    }
+    Receiver receiver(*params);
+    size_t failed_count = 0;
+    {
+        QueryCoalescer coalescer(receiver,*params,channel,max_items,chrono::milliseconds(absl::GetFlag(FLAGS_coalesce_window_ms)));
+
+        vector<future<QueryCoalescer::Result>> query_results;
+        for(auto &items : items_vec){
+            query_results.push_back(coalescer.submit(items));
+        }
+
+        for(size_t i = 0;i < query_files.size();i++){
+            try{
+                // output intersection result
+                print_intersection_result(orig_items[i],items_vec[i],query_results[i].get(),result_files[i]);
+            }catch(exception &ex){
+                APSI_LOG_ERROR("APSI query failed for " << query_files[i] << ":" << ex.what());
+                failed_count++;
+            }
+        }
+    }
 
     // output transmitted data size
     print_transmitted_data(channel);
 
+    if(failed_count > 0){
+        APSI_LOG_ERROR(failed_count << " of " << query_files.size() << " query jobs failed");
+        return -1;
+    }
 
     return 0;
 }
@@ -136,8 +192,21 @@ pair<unique_ptr<CSVReader::DBData>,vector<string>> load_db(const string &db_file
     vector<string> orig_items;
 
     try{
-        CSVReader reader(db_file);
-        tie(db_data,orig_items) = reader.read();
+        if(BinReader::IsBinFile(db_file)){
+            // 二进制文件中没有原始item,结果中以hash值的十六进制表示
+            BinReader reader(db_file);
+            db_data = reader.read();
+            if(holds_alternative<CSVReader::UnlabeledData>(db_data)){
+                const auto &items = get<CSVReader::UnlabeledData>(db_data);
+                orig_items.reserve(items.size());
+                for(const auto &item : items){
+                    orig_items.push_back(BinReader::ToHex(item));
+                }
+            }
+        }else{
+            CSVReader reader(db_file);
+            tie(db_data,orig_items) = reader.read();
+        }
     }catch(exception &ex){
         APSI_LOG_ERROR("Count not open or read file " << db_file << ":" << ex.what());
         return {nullptr,orig_items};
@@ -146,13 +215,25 @@ pair<unique_ptr<CSVReader::DBData>,vector<string>> load_db(const string &db_file
 }
 
 
+vector<string> split_paths(const string &paths){
+    vector<string> result;
+    stringstream ss(paths);
+    string path;
+    while(getline(ss,path,',')){
+        if(!path.empty()){
+            result.push_back(path);
+        }
+    }
+    return result;
+}
+
 void print_intersection_result(
         const vector<string> & orig_items,const vector<Item> &items,
-        const vector<MatchRecord> &intersection,
+        const QueryCoalescer::Result &intersection,
         const string &out_file
 ){
-    if(orig_items.size() != items.size()){
-        throw invalid_argument("orig_items must have same size as items");
+    if(orig_items.size() != items.size() || intersection.size() != items.size()){
+        throw invalid_argument("orig_items and intersection must have same size as items");
     }
     stringstream csv_output;
     for(size_t i = 0;i< orig_items.size();i++){
@@ -171,6 +252,10 @@ void print_intersection_result(
     if(! out_file.empty()){
         ofstream ofs(out_file);
         ofs << csv_output.str();
+        ofs.close();
+        if(!ofs){
+            throw runtime_error("could not write result file " + out_file);
+        }
         APSI_LOG_INFO("Wrote output to " << out_file);
 
     }
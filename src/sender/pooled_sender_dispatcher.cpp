@@ -0,0 +1,197 @@
+// std
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+// apsi
+#include <apsi/log.h>
+#include <apsi/oprf/ecpoint.h>
+#include <apsi/oprf/oprf_common.h>
+#include <apsi/query.h>
+#include <apsi/requests.h>
+#include <apsi/responses.h>
+#include <apsi/sender.h>
+
+// common
+#include "common/cpu_affinity.h"
+
+#include "pooled_sender_dispatcher.h"
+
+using namespace std;
+using namespace apsi;
+using namespace apsi::network;
+using namespace apsi::oprf;
+using namespace apsi::sender;
+
+PooledSenderDispatcher::PooledSenderDispatcher(
+        shared_ptr<SenderDB> sender_db,
+        OPRFKey oprf_key,
+        size_t oprf_thread_count,
+        const vector<int> &oprf_cpus
+) : sender_db_(std::move(sender_db)),
+    oprf_key_(std::move(oprf_key)),
+    oprf_pool_(oprf_thread_count),
+    query_pool_(1)
+{
+    if(!sender_db_){
+        throw invalid_argument("sender_db is not set");
+    }
+    if(oprf_thread_count == 0){
+        throw invalid_argument("oprf_thread_count must be positive");
+    }
+
+    // 绑定OPRF线程池;query线程池(ThreadPoolMgr)在创建SenderDB之前已经绑定
+    if(!oprf_cpus.empty()){
+        if(pin_thread_pool(oprf_pool_,oprf_thread_count,oprf_cpus)){
+            APSI_LOG_INFO("Pinned OPRF threads to " << oprf_cpus.size() << " cpus");
+        }else{
+            APSI_LOG_WARNING("Failed to pin OPRF threads; they run unpinned");
+        }
+    }
+    APSI_LOG_INFO("OPRF thread pool has " << oprf_thread_count << " threads");
+}
+
+void PooledSenderDispatcher::run(const atomic<bool> &stop, int port){
+    stringstream ss;
+    ss << "tcp://*:" << port;
+    APSI_LOG_INFO("PooledSenderDispatcher listening on port " << port);
+    chl_.bind(ss.str());
+
+    auto seal_context = sender_db_->get_seal_context();
+
+    bool logged_waiting = false;
+    while(!stop){
+        unique_ptr<ZMQSenderOperation> sop;
+        {
+            lock_guard<mutex> lock(channel_mtx_);
+            sop = chl_.receive_network_operation(seal_context);
+        }
+        if(!sop){
+            if(!logged_waiting){
+                logged_waiting = true;
+                APSI_LOG_INFO("Waiting for request from Receiver");
+            }
+            this_thread::sleep_for(50ms);
+            continue;
+        }
+
+        switch(sop->sop->type()){
+            case SenderOperationType::sop_parms:
+                APSI_LOG_INFO("Received parameter request");
+                dispatch_parms(std::move(sop));
+                break;
+            case SenderOperationType::sop_oprf:
+                APSI_LOG_INFO("Received OPRF request");
+                dispatch_oprf(std::move(sop));
+                break;
+            case SenderOperationType::sop_query:
+                APSI_LOG_INFO("Received query");
+                dispatch_query(std::move(sop));
+                break;
+            default:
+                APSI_LOG_WARNING("Received invalid operation; ignoring");
+                break;
+        }
+        logged_waiting = false;
+    }
+}
+
+void PooledSenderDispatcher::dispatch_parms(unique_ptr<ZMQSenderOperation> sop){
+    // 参数请求很轻量,直接在接收线程中处理
+    try{
+        ParamsRequest params_request = to_params_request(std::move(sop->sop));
+        Sender::RunParams(params_request,sender_db_,chl_,[this,&sop](Channel &c,Response response){
+            auto nsr = make_unique<ZMQSenderOperationResponse>();
+            nsr->sop_response = std::move(response);
+            nsr->client_id = sop->client_id;
+
+            lock_guard<mutex> lock(channel_mtx_);
+            static_cast<ZMQSenderChannel &>(c).send(std::move(nsr));
+        });
+    }catch(const exception &ex){
+        APSI_LOG_ERROR("Sender threw an exception while processing parameter request: " << ex.what());
+    }
+}
+
+void PooledSenderDispatcher::dispatch_oprf(shared_ptr<ZMQSenderOperation> sop){
+    oprf_pool_.enqueue([this,sop](){
+        try{
+            OPRFRequest oprf_request = to_oprf_request(std::move(sop->sop));
+
+            // 不调用Sender::RunOPRF:OPRFSender::ProcessQueries会把计算拆分到ThreadPoolMgr的全局线程池(即query线程池)中,
+            // 这里直接在当前OPRF线程中完成计算
+            OPRFResponse oprf_response = make_unique<SenderOperationResponseOPRF>();
+            oprf_response->data = process_oprf_queries(oprf_request->data);
+            APSI_LOG_INFO("Finished processing OPRF request for " << oprf_response->data.size() / oprf_response_size << " items");
+
+            auto nsr = make_unique<ZMQSenderOperationResponse>();
+            nsr->sop_response = std::move(oprf_response);
+            nsr->client_id = sop->client_id;
+
+            lock_guard<mutex> lock(channel_mtx_);
+            chl_.send(std::move(nsr));
+        }catch(const exception &ex){
+            APSI_LOG_ERROR("Sender threw an exception while processing OPRF request: " << ex.what());
+        }
+    });
+}
+
+vector<unsigned char> PooledSenderDispatcher::process_oprf_queries(const vector<unsigned char> &oprf_queries) const{
+    if(oprf_queries.size() % oprf_query_size){
+        throw invalid_argument("oprf_queries has invalid size");
+    }
+
+    size_t query_count = oprf_queries.size() / oprf_query_size;
+    vector<unsigned char> oprf_responses(query_count * oprf_response_size);
+
+    const unsigned char *oprf_in_ptr = oprf_queries.data();
+    unsigned char *oprf_out_ptr = oprf_responses.data();
+    for(size_t i = 0;i < query_count;i++){
+        ECPoint ecpt;
+        ecpt.load(ECPoint::point_save_span_const_type{ oprf_in_ptr,ECPoint::save_size });
+
+        // 与OPRFSender::ProcessQueries一致:乘以OPRF key并清除cofactor
+        if(!ecpt.scalar_multiply(oprf_key_.key_span(),true)){
+            throw logic_error("scalar multiplication failed due to invalid query data");
+        }
+
+        ecpt.save(ECPoint::point_save_span_type{ oprf_out_ptr,ECPoint::save_size });
+
+        oprf_in_ptr += oprf_query_size;
+        oprf_out_ptr += oprf_response_size;
+    }
+
+    return oprf_responses;
+}
+
+void PooledSenderDispatcher::dispatch_query(shared_ptr<ZMQSenderOperation> sop){
+    // RunQuery会阻塞直到ThreadPoolMgr中的计算完成,因此放到独立的派发线程中执行
+    query_pool_.enqueue([this,sop](){
+        try{
+            QueryRequest query_request = to_query_request(std::move(sop->sop));
+            Query query(std::move(query_request),sender_db_);
+            Sender::RunQuery(
+                    query,
+                    chl_,
+                    [this,&sop](Channel &c,Response response){
+                        auto nsr = make_unique<ZMQSenderOperationResponse>();
+                        nsr->sop_response = std::move(response);
+                        nsr->client_id = sop->client_id;
+
+                        lock_guard<mutex> lock(channel_mtx_);
+                        static_cast<ZMQSenderChannel &>(c).send(std::move(nsr));
+                    },
+                    [this,&sop](Channel &c,ResultPart rp){
+                        auto nrp = make_unique<ZMQResultPackage>();
+                        nrp->rp = std::move(rp);
+                        nrp->client_id = sop->client_id;
+
+                        lock_guard<mutex> lock(channel_mtx_);
+                        static_cast<ZMQSenderChannel &>(c).send(std::move(nrp));
+                    });
+        }catch(const exception &ex){
+            APSI_LOG_ERROR("Sender threw an exception while processing query: " << ex.what());
+        }
+    });
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+// STD
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// APSI
+#include <apsi/network/zmq/zmq_channel.h>
+#include <apsi/oprf/oprf_sender.h>
+#include <apsi/sender_db.h>
+#include <apsi/util/thread_pool.h>
+
+/**
+ * 与ZMQSenderDispatcher协议兼容的dispatcher
+ * OPRF计算完全在独立的OPRF线程池中完成,不向ThreadPoolMgr的全局线程池提交任务;
+ * query在单独的派发线程中处理,query计算使用ThreadPoolMgr的全局线程池,
+ * 因此一批OPRF请求不会占用query的计算线程,反之亦然
+ * 单个OPRF请求只由一个OPRF线程处理,多个OPRF请求之间并行
+ */
+class PooledSenderDispatcher{
+public:
+    PooledSenderDispatcher() = delete;
+
+    /**
+     * @param sender_db
+     * @param oprf_key
+     * @param oprf_thread_count OPRF线程池的线程数
+     * @param oprf_cpus OPRF线程绑定的cpu,为空则不绑定
+     */
+    PooledSenderDispatcher(
+            std::shared_ptr<apsi::sender::SenderDB> sender_db,
+            apsi::oprf::OPRFKey oprf_key,
+            std::size_t oprf_thread_count,
+            const std::vector<int> &oprf_cpus);
+
+    /**
+     * 监听端口并处理请求,直到stop为true
+     * @param stop
+     * @param port
+     */
+    void run(const std::atomic<bool> &stop, int port);
+
+private:
+    std::shared_ptr<apsi::sender::SenderDB> sender_db_;
+
+    apsi::oprf::OPRFKey oprf_key_;
+
+    // ZMQ socket不是线程安全的,所有收发操作都需要持有该锁
+    std::mutex channel_mtx_;
+
+    // channel和锁放在线程池之前声明,保证线程池先析构(等待未完成的任务)
+    apsi::network::ZMQSenderChannel chl_;
+
+    // OPRF请求线程池,OPRF计算只在这些线程中进行
+    apsi::util::ThreadPool oprf_pool_;
+
+    // query派发线程,query计算本身在ThreadPoolMgr中进行
+    apsi::util::ThreadPool query_pool_;
+
+    void dispatch_parms(std::unique_ptr<apsi::network::ZMQSenderOperation> sop);
+
+    void dispatch_oprf(std::shared_ptr<apsi::network::ZMQSenderOperation> sop);
+
+    /**
+     * 在当前线程中对OPRF请求中的每个点乘以OPRF key,逻辑与OPRFSender::ProcessQueries相同
+     * @param oprf_queries
+     * @return OPRF响应数据
+     */
+    std::vector<unsigned char> process_oprf_queries(const std::vector<unsigned char> &oprf_queries) const;
+
+    void dispatch_query(std::shared_ptr<apsi::network::ZMQSenderOperation> sop);
+};
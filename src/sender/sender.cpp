@@ -17,11 +17,15 @@
 #include <apsi/oprf/oprf_sender.h>
 #include <apsi/oprf/oprf_common.h>
 #include <apsi/sender.h>
-#include <apsi/zmq/sender_dispatcher.h>
 
 // common
+# include "common/bin_reader.h"
+# include "common/cpu_affinity.h"
 # include "common/csv_reader.h"
 
+// sender
+#include "pooled_sender_dispatcher.h"
+
 
 
 using namespace std;
@@ -32,9 +36,12 @@ using namespace apsi::sender;
 using namespace apsi::oprf;
 
 // absl参数
-ABSL_FLAG(uint32_t ,thread,10,"Number of thread");
+ABSL_FLAG(uint32_t ,thread,10,"Number of threads for query evaluation");
+ABSL_FLAG(uint32_t ,oprf_thread,2,"Number of threads for OPRF requests");
+ABSL_FLAG(std::string,query_cpus,"","CPUs to pin query evaluation threads to, e.g. 0-7,16-23 (default is no pinning)");
+ABSL_FLAG(std::string,oprf_cpus,"","CPUs to pin OPRF threads to, e.g. 8-9 (default keeps the original process affinity)");
 ABSL_FLAG(std::string,params_path,"./params.json","params file path");
-ABSL_FLAG(std::string,db_path,"./db.csv","db file path");
+ABSL_FLAG(std::string,db_path,"./db.csv","db file path(SenderDB, pre-hashed binary or csv)");
 ABSL_FLAG(uint32_t ,noce_byte_count,16,"Number of bytes used for the nonce in labeled mode (default is 16)");
 ABSL_FLAG(bool,compress,false,"Whether to compress the SenderDB in memory(default is false)");
 ABSL_FLAG(std::string,sdb_output_path,"","The Path of sdb save file(if is not empty)");
@@ -64,7 +71,7 @@ shared_ptr<SenderDB> try_load_csv_db(string db_path,OPRFKey &oprf_key);
 unique_ptr<PSIParams> build_psi_param();
 
 /**
- * 加载csv文件
+ * 加载csv文件或预先hash过的二进制文件
  * @param db_file
  * @return
  */
@@ -114,9 +121,36 @@ int main(int argc,char** argv){
 
 
 int startSender(){
+    vector<int> query_cpus,oprf_cpus;
+    try{
+        query_cpus = parse_cpu_list(absl::GetFlag(FLAGS_query_cpus));
+        oprf_cpus = parse_cpu_list(absl::GetFlag(FLAGS_oprf_cpus));
+    }catch(const exception &ex){
+        APSI_LOG_ERROR("Invalid cpu list: " << ex.what());
+        return -1;
+    }
+
     ThreadPoolMgr::SetThreadCount(absl::GetFlag(FLAGS_thread));
     APSI_LOG_INFO("setting thread to " << ThreadPoolMgr::GetThreadCount());
 
+    // 持有ThreadPoolMgr,使全局线程池(及其绑定)在整个服务期间保持有效
+    ThreadPoolMgr tpm;
+    // 先绑定当前线程和query线程池,再创建SenderDB:
+    // 按照first-touch策略,SenderDB的bundle数据会分配在query线程所在的NUMA节点上
+    // 当前线程只在创建SenderDB期间绑定,之后恢复原来的绑定,避免之后创建的OPRF线程和派发线程继承query cpu
+    vector<int> main_thread_cpus;
+    if(!query_cpus.empty()){
+        main_thread_cpus = current_thread_cpus();
+        bool pinned = pin_current_thread(query_cpus);
+        pinned = pin_thread_pool(tpm.thread_pool(),ThreadPoolMgr::GetThreadCount(),query_cpus) && pinned;
+        if(pinned){
+            APSI_LOG_INFO("Pinned query threads to " << absl::GetFlag(FLAGS_query_cpus));
+        }else{
+            APSI_LOG_WARNING("Failed to pin query threads to " << absl::GetFlag(FLAGS_query_cpus)
+                                                             << "; SenderDB memory may not be NUMA-local");
+        }
+    }
+
     // sender db 数据或原始csv数据
     string db_path = absl::GetFlag(FLAGS_db_path);
     OPRFKey oprf_key;
@@ -133,6 +167,11 @@ int startSender(){
         reload_from_sender_db = true;
     }
 
+    // 恢复当前线程原来的绑定
+    if(!main_thread_cpus.empty() && !pin_current_thread(main_thread_cpus)){
+        APSI_LOG_WARNING("Failed to restore main thread affinity; OPRF threads may inherit the query cpus");
+    }
+
     // 打印bin bundles相关数据
     uint32_t  max_bin_bundles_per_bundle_idx = 0;
     for(uint32_t bundle_idx = 0;bundle_idx < sender_db ->get_params().bundle_idx_count();bundle_idx++){
@@ -151,11 +190,17 @@ int startSender(){
         return -1;
     }
 
-    // 运行服务
+    // 运行服务,OPRF请求与query使用各自的线程池
     atomic<bool> stop = false;
-    ZMQSenderDispatcher dispatch(sender_db,oprf_key);
+    unique_ptr<PooledSenderDispatcher> dispatch;
+    try{
+        dispatch = make_unique<PooledSenderDispatcher>(sender_db,oprf_key,absl::GetFlag(FLAGS_oprf_thread),oprf_cpus);
+    }catch(const exception &ex){
+        APSI_LOG_ERROR("Failed to create dispatcher: " << ex.what());
+        return -1;
+    }
 
-    dispatch.run(stop,1212);
+    dispatch->run(stop,1212);
     return 0;
 }
 
@@ -202,7 +247,7 @@ shared_ptr<SenderDB> try_load_csv_db(string db_path,OPRFKey &oprf_key){
         APSI_LOG_ERROR("load db error");
         return nullptr;
     }
-    APSI_LOG_INFO("local csv db success");
+    APSI_LOG_INFO("load db success");
 
 
     return create_sender_db(*db_data,std::move(params),oprf_key,16,false) ;
@@ -243,18 +288,24 @@ unique_ptr<PSIParams> build_psi_param(){
 }
 
 /**
- * 加载csv文件
+ * 加载csv文件或预先hash过的二进制文件
  * @param db_file
  * @return
  */
 unique_ptr<CSVReader::DBData> load_db(string & db_file){
     CSVReader::DBData  db_data;
     try{
-        CSVReader csv_reader(db_file);
-        tie(db_data,ignore) = csv_reader.read();
-
+        if(BinReader::IsBinFile(db_file)){
+            // 二进制文件中的item已经hash过,无需解析和hash
+            BinReader bin_reader(db_file);
+            db_data = bin_reader.read();
+            APSI_LOG_INFO("Loaded pre-hashed binary db " << db_file);
+        }else{
+            CSVReader csv_reader(db_file);
+            tie(db_data,ignore) = csv_reader.read();
+        }
     }catch(exception &ex){
-        APSI_LOG_ERROR("read csv error" << ex.what());
+        APSI_LOG_ERROR("read db error" << ex.what());
         return nullptr;
     }
 